@@ -44,4 +44,17 @@ struct GPUMaterial
 	float4 albedo;
 	float metallic;
 	float roughness;
-};
\ No newline at end of file
+};
+
+#ifdef __cplusplus
+struct GPUMesh
+{
+	uint32_t index_count;
+
+	uint32_t scene_node;
+
+	GPUMaterial material;
+	GPUTexturedMaterial textured_material;
+	GfxBuffer vertex_buffer, index_buffer;
+};
+#endif
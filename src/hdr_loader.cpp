@@ -0,0 +1,520 @@
+#include "hdr_loader.h"
+#include "timer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <immintrin.h>
+#include <intrin.h>
+
+#include "stb_image.h"
+
+static bool HasF16C()
+{
+	int cpu_info[4];
+	__cpuid(cpu_info, 1);
+
+	// F16C works on the ymm registers, the OS also has to save the xmm and ymm state
+	const bool has_f16c    = (cpu_info[2] & (1 << 29)) != 0;
+	const bool has_osxsave = (cpu_info[2] & (1 << 27)) != 0;
+	return has_f16c && has_osxsave && (_xgetbv(0) & 0x6) == 0x6;
+}
+
+static const bool kHasF16C = HasF16C();
+
+// Scalar fallbacks, https://gist.github.com/rygorous/2156668
+static uint16_t FloatToHalf(float value)
+{
+	uint32_t f;
+	memcpy(&f, &value, sizeof(f));
+	const uint32_t sign = (f >> 16) & 0x8000;
+	f &= 0x7FFFFFFF;
+
+	uint16_t h;
+	if (f >= 0x47800000) // overflow to inf, keep NaNs
+	{
+		h = f > 0x7F800000 ? 0x7E00 : 0x7C00;
+	}
+	else if (f < 0x38800000) // denormals
+	{
+		float denormal;
+		memcpy(&denormal, &f, sizeof(f));
+		denormal += 0.5f;
+		uint32_t bits;
+		memcpy(&bits, &denormal, sizeof(bits));
+		h = static_cast<uint16_t>(bits - 0x3F000000);
+	}
+	else
+	{
+		const uint32_t mantissa_odd = (f >> 13) & 1;
+		f += 0xC8000FFF + mantissa_odd;
+		h = static_cast<uint16_t>(f >> 13);
+	}
+	return static_cast<uint16_t>(h | sign);
+}
+
+static float HalfToFloat(uint16_t h)
+{
+	const uint32_t shifted_exponent = 0x7C00 << 13;
+	uint32_t bits = (h & 0x7FFF) << 13;
+	const uint32_t exponent = shifted_exponent & bits;
+	bits += (127 - 15) << 23;
+	if (exponent == shifted_exponent) // inf/NaN
+	{
+		bits += (128 - 16) << 23;
+	}
+	else if (exponent == 0) // zero/denormal
+	{
+		bits += 1 << 23;
+		float value;
+		memcpy(&value, &bits, sizeof(bits));
+		value -= 6.10351563e-05f;
+		memcpy(&bits, &value, sizeof(bits));
+	}
+	bits |= (h & 0x8000) << 16;
+	float value;
+	memcpy(&value, &bits, sizeof(bits));
+	return value;
+}
+
+static inline void StorePixel(__m128 rgba, uint16_t* dst)
+{
+	if (kHasF16C)
+	{
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(dst), _mm_cvtps_ph(rgba, _MM_FROUND_TO_NEAREST_INT));
+	}
+	else
+	{
+		alignas(16) float values[4];
+		_mm_store_ps(values, rgba);
+		for (uint32_t i = 0; i < 4; ++i)
+			dst[i] = FloatToHalf(values[i]);
+	}
+}
+
+static inline __m128 LoadPixel(const uint16_t* src)
+{
+	if (kHasF16C)
+		return _mm_cvtph_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src)));
+	return _mm_setr_ps(HalfToFloat(src[0]), HalfToFloat(src[1]), HalfToFloat(src[2]), HalfToFloat(src[3]));
+}
+
+bool ReadHDRHeader(const uint8_t* data, size_t size, HDRHeader& header)
+{
+	size_t offset = 0;
+	auto read_line = [data, size, &offset](char* line, size_t max_length) -> bool
+	{
+		size_t length = 0;
+		while (offset < size && data[offset] != '\n')
+		{
+			if (length + 1 < max_length)
+				line[length++] = static_cast<char>(data[offset]);
+			++offset;
+		}
+		if (offset >= size)
+			return false;
+		++offset; // skip '\n'
+		line[length] = '\0';
+		return true;
+	};
+
+	char line[256];
+	if (!read_line(line, sizeof(line)) || (strcmp(line, "#?RADIANCE") != 0 && strcmp(line, "#?RGBE") != 0))
+		return false;
+
+	// Header variables end with an empty line
+	for (;;)
+	{
+		if (!read_line(line, sizeof(line)))
+			return false;
+		if (line[0] == '\0')
+			break;
+		if (strncmp(line, "FORMAT=", 7) == 0 && strcmp(line, "FORMAT=32-bit_rle_rgbe") != 0)
+			return false;
+	}
+
+	// Only the standard orientation is supported, same as stb_image
+	int width, height;
+	if (!read_line(line, sizeof(line)) || sscanf_s(line, "-Y %d +X %d", &height, &width) != 2 || width <= 0 || height <= 0)
+		return false;
+
+	header.width         = static_cast<uint32_t>(width);
+	header.height        = static_cast<uint32_t>(height);
+	header.pixels_offset = offset;
+	return true;
+}
+
+static inline bool IsRLEScanline(const uint8_t* scanline, uint32_t width)
+{
+	return width >= 8 && width < 32768 && scanline[0] == 2 && scanline[1] == 2 && (scanline[2] & 0x80) == 0;
+}
+
+// Validates a scanline and moves offset to the next one, only reading the run lengths
+static bool SkipScanline(const uint8_t* data, size_t size, uint32_t width, size_t& offset)
+{
+	if (offset + 4 > size)
+		return false;
+
+	if (!IsRLEScanline(data + offset, width))
+	{
+		if (offset + width * 4ull > size)
+			return false;
+		offset += width * 4ull;
+		return true;
+	}
+
+	if (((data[offset + 2] << 8) | data[offset + 3]) != static_cast<int>(width))
+		return false;
+	offset += 4;
+
+	for (uint32_t channel = 0; channel < 4; ++channel)
+	{
+		for (uint32_t x = 0; x < width;)
+		{
+			if (offset >= size)
+				return false;
+			uint32_t count = data[offset++];
+			const uint32_t bytes = count > 128 ? 1 : count;
+			if (count > 128)
+				count -= 128;
+			if (count == 0 || x + count > width || offset + bytes > size)
+				return false;
+			offset += bytes;
+			x += count;
+		}
+	}
+	return true;
+}
+
+// Decodes a scanline that went through SkipScanline into interleaved RGBE
+static void DecodeScanline(const uint8_t* scanline, uint32_t width, uint8_t* rgbe)
+{
+	if (!IsRLEScanline(scanline, width))
+	{
+		memcpy(rgbe, scanline, width * 4ull);
+		return;
+	}
+
+	scanline += 4;
+	for (uint32_t channel = 0; channel < 4; ++channel)
+	{
+		for (uint32_t x = 0; x < width;)
+		{
+			uint32_t count = *scanline++;
+			if (count > 128)
+			{
+				count -= 128;
+				const uint8_t value = *scanline++;
+				for (uint32_t i = 0; i < count; ++i)
+					rgbe[(x + i) * 4 + channel] = value;
+			}
+			else
+			{
+				for (uint32_t i = 0; i < count; ++i)
+					rgbe[(x + i) * 4 + channel] = *scanline++;
+			}
+			x += count;
+		}
+	}
+}
+
+// RGBE to RGBA float (same scale as stb_image, mantissa * 2^(e - 136)), also written out as half
+static void ConvertScanline(const uint8_t* rgbe, uint32_t width, float* rgba, uint16_t* pixels)
+{
+	const __m128i exponent_bias = _mm_set1_epi32(9);
+	const __m128i min_exponent  = _mm_set1_epi32(9);
+	const __m128  rgb_mask      = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+	const __m128  alpha         = _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f);
+	const __m128i zero          = _mm_setzero_si128();
+
+	auto convert_pixel = [&](__m128i pixel, float* out_rgba, uint16_t* out_pixel)
+	{
+		// Exponents below 10 would be float denormals, those are zero once converted to half anyway
+		const __m128i exponent = _mm_shuffle_epi32(pixel, _MM_SHUFFLE(3, 3, 3, 3));
+		const __m128i scale_bits = _mm_and_si128(_mm_slli_epi32(_mm_sub_epi32(exponent, exponent_bias), 23), _mm_cmpgt_epi32(exponent, min_exponent));
+		__m128 value = _mm_mul_ps(_mm_cvtepi32_ps(pixel), _mm_castsi128_ps(scale_bits));
+		value = _mm_or_ps(_mm_and_ps(value, rgb_mask), alpha);
+		_mm_storeu_ps(out_rgba, value);
+		StorePixel(value, out_pixel);
+	};
+
+	uint32_t x = 0;
+	for (; x + 4 <= width; x += 4)
+	{
+		const __m128i bytes  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgbe + x * 4));
+		const __m128i words0 = _mm_unpacklo_epi8(bytes, zero);
+		const __m128i words1 = _mm_unpackhi_epi8(bytes, zero);
+		convert_pixel(_mm_unpacklo_epi16(words0, zero), rgba + (x + 0) * 4, pixels + (x + 0) * 4);
+		convert_pixel(_mm_unpackhi_epi16(words0, zero), rgba + (x + 1) * 4, pixels + (x + 1) * 4);
+		convert_pixel(_mm_unpacklo_epi16(words1, zero), rgba + (x + 2) * 4, pixels + (x + 2) * 4);
+		convert_pixel(_mm_unpackhi_epi16(words1, zero), rgba + (x + 3) * 4, pixels + (x + 3) * 4);
+	}
+	for (; x < width; ++x)
+	{
+		const uint8_t* texel = rgbe + x * 4;
+		convert_pixel(_mm_setr_epi32(texel[0], texel[1], texel[2], texel[3]), rgba + x * 4, pixels + x * 4);
+	}
+}
+
+bool DecodeHDRPixels(const uint8_t* data, size_t size, const HDRHeader& header, uint16_t* pixels, uint16_t* mip_pixels)
+{
+	const uint32_t width  = header.width;
+	const uint32_t height = header.height;
+
+	// Scanlines have variable sizes, find where each one starts before splitting the work
+	std::vector<size_t> scanline_offsets(height);
+	size_t offset = header.pixels_offset;
+	for (uint32_t y = 0; y < height; ++y)
+	{
+		scanline_offsets[y] = offset;
+		if (!SkipScanline(data, size, width, offset))
+			return false;
+	}
+
+	// Work on pairs of scanlines so each chunk can also output its rows of the first mip
+	const uint32_t mip_width  = std::max(1u, width / 2);
+	const uint32_t mip_height = std::max(1u, height / 2);
+	const uint32_t pair_count = (height + 1) / 2;
+	const uint32_t thread_count = std::max(1u, std::min(std::thread::hardware_concurrency(), pair_count));
+
+	auto decode_pairs = [&](uint32_t first_pair, uint32_t last_pair)
+	{
+		std::vector<uint8_t> rgbe(width * 4ull);
+		std::vector<float> rows(width * 8ull);
+		float* row0 = rows.data();
+		float* row1 = rows.data() + width * 4ull;
+
+		for (uint32_t pair = first_pair; pair < last_pair; ++pair)
+		{
+			const uint32_t y0 = pair * 2;
+			const uint32_t y1 = std::min(y0 + 1, height - 1);
+
+			DecodeScanline(data + scanline_offsets[y0], width, rgbe.data());
+			ConvertScanline(rgbe.data(), width, row0, pixels + y0 * width * 4ull);
+			if (y1 != y0)
+			{
+				DecodeScanline(data + scanline_offsets[y1], width, rgbe.data());
+				ConvertScanline(rgbe.data(), width, row1, pixels + y1 * width * 4ull);
+			}
+
+			if (!mip_pixels || pair >= mip_height)
+				continue;
+
+			const float* bottom_row = y1 != y0 ? row1 : row0;
+			const __m128 quarter = _mm_set1_ps(0.25f);
+			uint16_t* mip_row = mip_pixels + pair * mip_width * 4ull;
+			for (uint32_t x = 0; x < mip_width; ++x)
+			{
+				const uint32_t x0 = std::min(x * 2, width - 1) * 4;
+				const uint32_t x1 = std::min(x * 2 + 1, width - 1) * 4;
+				__m128 sum = _mm_add_ps(_mm_loadu_ps(row0 + x0), _mm_loadu_ps(row0 + x1));
+				sum = _mm_add_ps(sum, _mm_add_ps(_mm_loadu_ps(bottom_row + x0), _mm_loadu_ps(bottom_row + x1)));
+				StorePixel(_mm_mul_ps(sum, quarter), mip_row + x * 4);
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	threads.reserve(thread_count);
+	const uint32_t pairs_per_thread = (pair_count + thread_count - 1) / thread_count;
+	for (uint32_t first_pair = 0; first_pair < pair_count; first_pair += pairs_per_thread)
+		threads.emplace_back(decode_pairs, first_pair, std::min(first_pair + pairs_per_thread, pair_count));
+	for (std::thread& thread : threads)
+		thread.join();
+
+	return true;
+}
+
+void DownsampleHDRMip(const uint16_t* src, uint32_t width, uint32_t height, uint16_t* dst)
+{
+	const uint32_t dst_width  = std::max(1u, width / 2);
+	const uint32_t dst_height = std::max(1u, height / 2);
+	const __m128 quarter = _mm_set1_ps(0.25f);
+
+	for (uint32_t y = 0; y < dst_height; ++y)
+	{
+		const uint16_t* row0 = src + std::min(y * 2, height - 1) * width * 4ull;
+		const uint16_t* row1 = src + std::min(y * 2 + 1, height - 1) * width * 4ull;
+		for (uint32_t x = 0; x < dst_width; ++x)
+		{
+			const uint32_t x0 = std::min(x * 2, width - 1) * 4;
+			const uint32_t x1 = std::min(x * 2 + 1, width - 1) * 4;
+			__m128 sum = _mm_add_ps(LoadPixel(row0 + x0), LoadPixel(row0 + x1));
+			sum = _mm_add_ps(sum, _mm_add_ps(LoadPixel(row1 + x0), LoadPixel(row1 + x1)));
+			StorePixel(_mm_mul_ps(sum, quarter), dst + (y * dst_width + x) * 4ull);
+		}
+	}
+}
+
+struct MappedFile
+{
+	HANDLE file;
+	HANDLE mapping;
+	const uint8_t* data;
+	size_t size;
+};
+
+static bool MapFile(const char* path, MappedFile& mapped_file)
+{
+	mapped_file = {};
+	mapped_file.file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (mapped_file.file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(mapped_file.file, &file_size) || file_size.QuadPart == 0)
+	{
+		CloseHandle(mapped_file.file);
+		return false;
+	}
+
+	mapped_file.mapping = CreateFileMappingA(mapped_file.file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapped_file.mapping)
+	{
+		CloseHandle(mapped_file.file);
+		return false;
+	}
+
+	mapped_file.data = static_cast<const uint8_t*>(MapViewOfFile(mapped_file.mapping, FILE_MAP_READ, 0, 0, 0));
+	mapped_file.size = static_cast<size_t>(file_size.QuadPart);
+	if (!mapped_file.data)
+	{
+		CloseHandle(mapped_file.mapping);
+		CloseHandle(mapped_file.file);
+		return false;
+	}
+	return true;
+}
+
+static void UnmapFile(MappedFile& mapped_file)
+{
+	UnmapViewOfFile(mapped_file.data);
+	CloseHandle(mapped_file.mapping);
+	CloseHandle(mapped_file.file);
+	mapped_file = {};
+}
+
+static bool DecodeHDRTexture(MappedFile mapped_file, const HDRHeader& header, uint32_t mip_count, uint16_t* upload_data)
+{
+	const uint64_t level0_size = header.width * header.height * 4ull;
+	uint64_t mip_chain_size = 0;
+	for (uint32_t level = 1; level < mip_count; ++level)
+		mip_chain_size += std::max(1u, header.width >> level) * std::max(1u, header.height >> level) * 4ull;
+
+	// Smaller mips are kept in system memory as they are read back to generate the next level
+	std::vector<uint16_t> mip_chain(mip_chain_size);
+	const bool result = DecodeHDRPixels(mapped_file.data, mapped_file.size, header, upload_data, mip_count > 1 ? mip_chain.data() : nullptr);
+	UnmapFile(mapped_file);
+	if (!result)
+		return false;
+
+	uint16_t* mip = mip_chain.data();
+	for (uint32_t level = 1; level + 1 < mip_count; ++level)
+	{
+		const uint32_t mip_width  = std::max(1u, header.width >> level);
+		const uint32_t mip_height = std::max(1u, header.height >> level);
+		uint16_t* next_mip = mip + mip_width * mip_height * 4ull;
+		DownsampleHDRMip(mip, mip_width, mip_height, next_mip);
+		mip = next_mip;
+	}
+	if (mip_chain_size > 0)
+		memcpy(upload_data + level0_size, mip_chain.data(), mip_chain_size * sizeof(uint16_t));
+	return true;
+}
+
+bool StartHDRTextureLoad(GfxContext gfx, const char* path, HDRTextureLoad& load)
+{
+	load.is_decoded = false;
+	load.result = false;
+
+	MappedFile mapped_file;
+	if (!MapFile(path, mapped_file))
+		return false;
+
+	if (!ReadHDRHeader(mapped_file.data, mapped_file.size, load.header))
+	{
+		UnmapFile(mapped_file);
+		return false;
+	}
+
+	load.mip_count = gfxCalculateMipCount(load.header.width, load.header.height);
+
+	// The upload buffer holds every mip level tightly packed, level 0 gets decoded straight into it.
+	// It is created here as gfx calls are only made from the main thread.
+	uint64_t upload_size = 0;
+	for (uint32_t level = 0; level < load.mip_count; ++level)
+		upload_size += std::max(1u, load.header.width >> level) * std::max(1u, load.header.height >> level) * 4ull;
+
+	load.upload_buffer = gfxCreateBuffer(gfx, upload_size * sizeof(uint16_t), nullptr, kGfxCpuAccess_Write);
+	uint16_t* upload_data = gfxBufferGetData<uint16_t>(gfx, load.upload_buffer);
+
+	load.thread = std::thread([&load, mapped_file, upload_data]()
+	{
+		load.result = DecodeHDRTexture(mapped_file, load.header, load.mip_count, upload_data);
+		load.is_decoded.store(true, std::memory_order_release);
+	});
+	return true;
+}
+
+bool IsHDRTextureLoadDone(const HDRTextureLoad& load)
+{
+	return load.is_decoded.load(std::memory_order_acquire);
+}
+
+GfxTexture FinishHDRTextureLoad(GfxContext gfx, HDRTextureLoad& load)
+{
+	if (load.thread.joinable())
+		load.thread.join();
+
+	GfxTexture texture;
+	if (load.result)
+	{
+		texture = gfxCreateTexture2D(gfx, load.header.width, load.header.height, DXGI_FORMAT_R16G16B16A16_FLOAT, load.mip_count);
+		gfxCommandCopyBufferToTexture(gfx, texture, load.upload_buffer);
+	}
+	gfxDestroyBuffer(gfx, load.upload_buffer);
+	load.upload_buffer = {};
+
+	return texture;
+}
+
+GfxTexture LoadHDRTexture(GfxContext gfx, const char* path)
+{
+	HDRTextureLoad load;
+	bool result = StartHDRTextureLoad(gfx, path, load);
+	GFX_ASSERT(result);
+
+	GfxTexture texture = FinishHDRTextureLoad(gfx, load);
+	GFX_ASSERT(texture);
+	return texture;
+}
+
+HDRBenchmark BenchmarkHDRDecode(const char* path)
+{
+	HDRBenchmark benchmark = {};
+	Timer timer;
+
+	int width, height, num_channels;
+	float* stb_data = stbi_loadf(path, &width, &height, &num_channels, 4);
+	benchmark.stb_ms = timer.ElapsedMilliseconds();
+	GFX_ASSERT(stb_data);
+	stbi_image_free(stb_data);
+
+	timer.Record();
+	MappedFile mapped_file;
+	bool result = MapFile(path, mapped_file);
+	GFX_ASSERT(result);
+	HDRHeader header;
+	result = ReadHDRHeader(mapped_file.data, mapped_file.size, header);
+	GFX_ASSERT(result);
+	std::vector<uint16_t> pixels(header.width * header.height * 4ull);
+	std::vector<uint16_t> mip_pixels(std::max(1u, header.width / 2) * std::max(1u, header.height / 2) * 4ull);
+	result = DecodeHDRPixels(mapped_file.data, mapped_file.size, header, pixels.data(), mip_pixels.data());
+	GFX_ASSERT(result);
+	benchmark.file_size_mb = static_cast<float>(mapped_file.size) / (1024.0f * 1024.0f);
+	UnmapFile(mapped_file);
+	benchmark.decoder_ms = timer.ElapsedMilliseconds();
+
+	return benchmark;
+}
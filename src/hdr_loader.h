@@ -0,0 +1,54 @@
+#pragma once
+
+#include <gfx.h>
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+// Radiance .hdr (RGBE) loader decoding straight to RGBA16F, see LoadHDRTexture
+struct HDRHeader
+{
+	uint32_t width;
+	uint32_t height;
+	size_t pixels_offset; // offset of the first scanline from the start of the file
+};
+
+// Texture being decoded on a background thread straight into its upload buffer, see StartHDRTextureLoad
+struct HDRTextureLoad
+{
+	HDRHeader header;
+	uint32_t mip_count;
+	GfxBuffer upload_buffer;
+	std::thread thread;
+	std::atomic<bool> is_decoded = false;
+	bool result;
+};
+
+struct HDRBenchmark
+{
+	float file_size_mb;
+	float stb_ms;
+	float decoder_ms;
+};
+
+bool ReadHDRHeader(const uint8_t* data, size_t size, HDRHeader& header);
+
+// Decodes every scanline as RGBA16F into pixels, and writes the 2x2 box filtered first mip
+// into mip_pixels when not null. Scanlines are decoded in parallel chunks.
+bool DecodeHDRPixels(const uint8_t* data, size_t size, const HDRHeader& header, uint16_t* pixels, uint16_t* mip_pixels);
+
+// 2x2 box filter of a RGBA16F image into the next mip level
+void DownsampleHDRMip(const uint16_t* src, uint32_t width, uint32_t height, uint16_t* dst);
+
+// Maps the file and creates the upload buffer, then decodes it and generates the mip chain on the CPU
+// from a background thread. The load must be finished with FinishHDRTextureLoad once started.
+bool StartHDRTextureLoad(GfxContext gfx, const char* path, HDRTextureLoad& load);
+bool IsHDRTextureLoadDone(const HDRTextureLoad& load);
+
+// Waits for the decode if needed, then creates the texture and records the upload
+GfxTexture FinishHDRTextureLoad(GfxContext gfx, HDRTextureLoad& load);
+
+GfxTexture LoadHDRTexture(GfxContext gfx, const char* path);
+
+HDRBenchmark BenchmarkHDRDecode(const char* path);
@@ -5,6 +5,9 @@
 #include "timer.h"
 #include "camera.h"
 #include "gpu_shared.h"
+#include "scene_streamer.h"
+#include "scene_graph.h"
+#include "hdr_loader.h"
 
 #include "imgui_demo.cpp"
 
@@ -16,52 +19,30 @@
 
 #include "stb_image.h"
 
-struct GPUMesh
-{
-	uint32_t index_count;
-
-	glm::mat4 transform = glm::mat4(1.0f);
-
-	GPUMaterial material;
-	GPUTexturedMaterial textured_material;
-	GfxBuffer vertex_buffer, index_buffer;
-};
-
 GfxTexture gfxLoadTexture2D(GfxContext gfx, std::filesystem::path path)
 {
-	void* data;
+	// Environment maps get decoded straight to half floats, with their mips generated on the CPU
+	if (path.extension() == ".hdr")
+		return LoadHDRTexture(gfx, path.string().c_str());
+
 	int width, height, num_channels, bytes_per_channel;
 	DXGI_FORMAT format;
-	if (path.extension() == ".hdr") 
+	void* data = stbi_load(path.string().c_str(), &width, &height, &num_channels, 4);
+	GFX_ASSERT(data);
+	if (stbi_is_16_bit(path.string().c_str()))
 	{
-		data = stbi_loadf(path.string().c_str(), &width, &height, &num_channels, 4);
-		GFX_ASSERT(data);
-		format = DXGI_FORMAT_R32G32B32A32_FLOAT;
-		bytes_per_channel = 4;
+		bytes_per_channel = 2;
+		format = DXGI_FORMAT_R16G16B16A16_UNORM;
 	}
 	else
 	{
-		data = stbi_load(path.string().c_str(), &width, &height, &num_channels, 4);
-		GFX_ASSERT(data);
-		if (stbi_is_16_bit(path.string().c_str()))
-		{
-			bytes_per_channel = 2;
-			format = DXGI_FORMAT_R16G16B16A16_UNORM;
-		}
-		else
-		{
-			bytes_per_channel = 1;
-			format = DXGI_FORMAT_R8G8B8A8_UNORM;
-		}
+		bytes_per_channel = 1;
+		format = DXGI_FORMAT_R8G8B8A8_UNORM;
 	}
 
 	num_channels = num_channels != 4 ? 4 : num_channels;
 
-	bool generate_mips = true;
-	if (path.extension() != ".hdr") 
-		generate_mips = false;
-
-	GfxTexture texture = gfxCreateTexture2D(gfx, width, height, format, generate_mips ? gfxCalculateMipCount(width, height) : 1);
+	GfxTexture texture = gfxCreateTexture2D(gfx, width, height, format, 1);
 
 	uint32_t const texture_size = width * height * num_channels * bytes_per_channel;
 
@@ -69,8 +50,6 @@ GfxTexture gfxLoadTexture2D(GfxContext gfx, std::filesystem::path path)
 
 	gfxCommandCopyBufferToTexture(gfx, texture, upload_texture_buffer);
 	gfxDestroyBuffer(gfx, upload_texture_buffer);
-	if (generate_mips)
-		gfxCommandGenerateMips(gfx, texture);
 
 	stbi_image_free(data);
 
@@ -81,6 +60,8 @@ GfxTexture gfxLoadTexture2D(GfxContext gfx, std::filesystem::path path)
 
 int main()
 {
+	Timer startup_timer;
+
 	auto window = gfxCreateWindow(1280, 720, "gfx_pbr");
 
 	GfxCreateContextFlags ctxFlags = 0;
@@ -94,14 +75,7 @@ int main()
 	GfxSamplerState linear_clamp_sampler = gfxCreateSamplerState(gfx, D3D12_FILTER_MIN_MAG_MIP_LINEAR);
 	GfxSamplerState linear_wrap_sampler = gfxCreateSamplerState(gfx, D3D12_FILTER_MIN_MAG_MIP_LINEAR, D3D12_TEXTURE_ADDRESS_MODE_WRAP, D3D12_TEXTURE_ADDRESS_MODE_WRAP, D3D12_TEXTURE_ADDRESS_MODE_WRAP);
 
-	//gfxSceneImport(scene, "assets/models/flying_world_battle_of_the_trash_god/FlyingWorld-BattleOfTheTrashGod.gltf");
-	//gfxSceneImport(scene, "assets/models/sphere/sphere.gltf");
-	//gfxSceneImport(scene, "assets/models/cerberus/scene.gltf");
-	//gfxSceneImport(scene, "assets/models/DamagedHelmet/DamagedHelmet.gltf");
-	gfxSceneImport(scene, "assets/models/Sponza/Sponza.gltf");
 	gfxSceneImport(scene, "assets/models/skybox.obj");
-	const uint32_t instancesCount = gfxSceneGetInstanceCount(scene);
-	const GfxInstance* instances  = gfxSceneGetInstances(scene);
 
 	GfxTexture empty_texture;
 	{
@@ -116,68 +90,22 @@ int main()
 		gfxDestroyBuffer(gfx, upload_texture_buffer);
 	}
 
-	// Send mesh data to the gpu
-	std::vector<GPUMesh> gpu_meshes(instancesCount - 1);
-	for (uint32_t i = 0; i < instancesCount - 1; ++i)
-	{
-		GfxInstance instance = instances[i];
-		const GfxConstRef<GfxMesh>& mesh = instance.mesh;
-		GPUMesh& gpu_mesh = gpu_meshes[i];
-
-		gpu_mesh.material = {};
-		if (mesh->material)
-		{
-			auto load_texture = [gfx, empty_texture](GfxConstRef<GfxImage> image_ref) -> GfxTexture
-			{
-				if (image_ref)
-				{
-					GfxTexture texture = gfxCreateTexture2D(gfx, image_ref->width, image_ref->height, image_ref->format, gfxCalculateMipCount(image_ref->width, image_ref->height));
-
-					uint32_t const texture_size = image_ref->width * image_ref->height * image_ref->channel_count * image_ref->bytes_per_channel;
-
-					GfxBuffer upload_texture_buffer = gfxCreateBuffer(gfx, texture_size, image_ref->data.data(), kGfxCpuAccess_Write);
-
-					gfxCommandCopyBufferToTexture(gfx, texture, upload_texture_buffer);
-					gfxDestroyBuffer(gfx, upload_texture_buffer);
-					gfxCommandGenerateMips(gfx, texture);
-
-					return texture;
-				}
-				else
-				{
-					return empty_texture;
-				}
-			};
-
-			GfxMaterial mat = *mesh->material;
-
-			gpu_mesh.material.albedo    = mesh->material->albedo;
-			gpu_mesh.material.roughness = mesh->material->roughness;
-			gpu_mesh.material.metallic  = mesh->material->metallicity;
-
-			gpu_mesh.textured_material.albedo_texture = load_texture(mesh->material->albedo_map);
-			gpu_mesh.textured_material.metallic_texture = load_texture(mesh->material->metallicity_map);
-			gpu_mesh.textured_material.roughness_texture = load_texture(mesh->material->roughness_map);
-			gpu_mesh.textured_material.emissive_texture = load_texture(mesh->material->emissivity_map);
-		}
-		else
-		{
-			gpu_mesh.material.albedo    = float4(1.0f);
-			gpu_mesh.material.roughness = 1.0f;
-			gpu_mesh.material.metallic  = 1.0f;
-		}
+	Camera camera = CreateCamera(gfx, glm::vec3(0.0f, 0.0f, 5.0f), glm::vec3(0.0f, 0.0f, -1.0f));
 
-#if SPHERE // for the sphere
-		gpu_mesh.textured_material.albedo_texture = gfxLoadTexture2D(gfx, "assets/textures/rusted_iron/albedo.png");
-		gpu_mesh.textured_material.metallic_texture = gfxLoadTexture2D(gfx, "assets/textures/rusted_iron/metallic.png");
-		gpu_mesh.textured_material.roughness_texture = gfxLoadTexture2D(gfx, "assets/textures/rusted_iron/roughness.png");
-#endif
-
-		gpu_mesh.transform	   = instance.transform;
-		gpu_mesh.index_count   = static_cast<uint32_t>(mesh->indices.size());
-		gpu_mesh.vertex_buffer = gfxCreateBuffer(gfx, sizeof(GfxVertex) * mesh->vertices.size(), mesh->vertices.data());
-		gpu_mesh.index_buffer  = gfxCreateBuffer(gfx, sizeof(uint32_t) * mesh->indices.size(), mesh->indices.data());
-	}
+	// All the meshes are parented to the scene root, which also carries the model scale.
+	// Their world transforms get updated every frame.
+	SceneGraph scene_graph;
+	uint32_t scene_root = AddSceneNode(scene_graph, kInvalidSceneNode, glm::scale(glm::mat4(1.0f), glm::vec3(1.5f)));
+	UpdateSceneGraph(scene_graph);
+
+	// Stream mesh data to the gpu, meshes show up with placeholder textures while the rest loads in the background
+	SceneStreamer scene_streamer;
+	//StartSceneStreaming(scene_streamer, "assets/models/flying_world_battle_of_the_trash_god/FlyingWorld-BattleOfTheTrashGod.gltf", camera.eye, scene_graph, scene_root);
+	//StartSceneStreaming(scene_streamer, "assets/models/sphere/sphere.gltf", camera.eye, scene_graph, scene_root);
+	//StartSceneStreaming(scene_streamer, "assets/models/cerberus/scene.gltf", camera.eye, scene_graph, scene_root);
+	//StartSceneStreaming(scene_streamer, "assets/models/DamagedHelmet/DamagedHelmet.gltf", camera.eye, scene_graph, scene_root);
+	StartSceneStreaming(scene_streamer, "assets/models/Sponza/Sponza.gltf", camera.eye, scene_graph, scene_root);
+	std::vector<GPUMesh>& gpu_meshes = scene_streamer.meshes;
 
 	float vertices[] = {  0.5f, -0.5f, 0.0f,
 						  0.0f,  0.7f, 0.0f,
@@ -228,11 +156,10 @@ int main()
 	GPUMesh skybox_mesh = {};
 	bool has_to_change_env_map = true;
 	auto load_env_map = [&gfx, &skybox_mesh, &environment_cube, &irradiance_map, 
-						 &prefilter_map, &brdf_lut_map, &scene, &linear_wrap_sampler, &has_to_change_env_map]
-						 (std::string_view env_map_path)
+						 &prefilter_map, &brdf_lut_map, &scene, &linear_wrap_sampler]
+						 (GfxTexture environment_map)
 	{
 		// Load skybox stuff
-		GfxTexture environment_map = gfxLoadTexture2D(gfx, env_map_path);
 		const GfxConstRef<GfxMesh>& skybox_handle = gfxSceneFindObjectByAssetFile<GfxMesh>(scene, "assets/models/skybox.obj");
 		skybox_mesh.index_count = static_cast<uint32_t>(skybox_handle->indices.size());
 		if (skybox_mesh.vertex_buffer)
@@ -290,15 +217,15 @@ int main()
 			gfxProgramSetParameter(gfx, ibl_program, "LUT", brdf_lut_map);
 			gfxCommandDispatch(gfx, brdf_lut_map.getWidth() / 32, brdf_lut_map.getHeight() / 32, 6);
 		}
-
-		has_to_change_env_map = false;
 	};
 
+	// .hdr environments get decoded on a background thread, the IBL bake runs once they are ready
+	HDRTextureLoad env_map_load;
+	bool is_loading_env_map = false;
+
 	GfxProgram compositeProgram = gfxCreateProgram(gfx, "shaders/scene_composite");
 	GfxKernel compositeKernel   = gfxCreateGraphicsKernel(gfx, compositeProgram);
 
-	Camera camera = CreateCamera(gfx, glm::vec3(0.0f, 0.0f, 5.0f), glm::vec3(0.0f, 0.0f, -1.0f));
-
 	// Debug views
 	std::array<const char*, 7> debug_views = { "Full", "Color", "Normal", "World Position", "Metallic", "Roughness", "Emissive"};
 	int selected_debug_view = 0;
@@ -309,13 +236,24 @@ int main()
 	const char* env_maps_path = "assets/environment";
 	for (const auto& entry : std::filesystem::directory_iterator(env_maps_path))
 		env_maps.emplace_back(entry.path());
-	load_env_map(env_maps[selected_env_map].string());
+
+	// Startup statistics
+	float time_to_first_frame = 0.0f;
+	float time_to_fully_loaded = 0.0f;
+	bool is_fully_loaded = false;
+
+	SceneGraphBenchmark scene_graph_benchmark = {};
+	HDRBenchmark hdr_benchmark = {};
+#if SPHERE
+	bool has_sphere_textures = false;
+#endif
 
 	glm::vec3 light_position(-1.0f, 1.0f, 2.0f);
 	glm::vec3 light_color(1.0f);
 
 	Timer deltaTimer;
-	for (float time = 0.0f; !gfxWindowIsCloseRequested(window); time += 0.1f)
+	uint32_t frame_index = 0;
+	for (float time = 0.0f; !gfxWindowIsCloseRequested(window); time += 0.1f, ++frame_index)
 	{
 		float deltaTime = deltaTimer.ElapsedMilliseconds();
 		deltaTimer.Record();
@@ -324,10 +262,62 @@ int main()
 
 		UpdateCamera(gfx, window, camera, deltaTime);
 
+		UpdateSceneStreaming(gfx, scene_streamer, scene_graph, empty_texture);
+		UpdateSceneGraph(scene_graph);
+		if (!is_fully_loaded && frame_index > 0 && !has_to_change_env_map && !is_loading_env_map && IsSceneStreamingComplete(scene_streamer))
+		{
+			is_fully_loaded = true;
+			time_to_fully_loaded = startup_timer.ElapsedMilliseconds();
+			GFX_PRINTLN("Time to fully loaded: %.2fms", time_to_fully_loaded);
+
+			// Nodes were added in streaming order, lay them out breadth-first now that the scene is complete
+			std::vector<uint32_t> scene_node_remap;
+			SortSceneGraph(scene_graph, &scene_node_remap);
+			scene_root = scene_node_remap[scene_root];
+			scene_streamer.parent_node = scene_root;
+			for (GPUMesh& mesh : gpu_meshes)
+				mesh.scene_node = scene_node_remap[mesh.scene_node];
+		}
+
+#if SPHERE // for the sphere
+		if (!has_sphere_textures && !gpu_meshes.empty())
+		{
+			gpu_meshes[0].textured_material.albedo_texture = gfxLoadTexture2D(gfx, "assets/textures/rusted_iron/albedo.png");
+			gpu_meshes[0].textured_material.metallic_texture = gfxLoadTexture2D(gfx, "assets/textures/rusted_iron/metallic.png");
+			gpu_meshes[0].textured_material.roughness_texture = gfxLoadTexture2D(gfx, "assets/textures/rusted_iron/roughness.png");
+			has_sphere_textures = true;
+		}
+#endif
+
 		if (ImGui::Begin("Debug"))
 		{
 			ImGui::Text("CPU: %.2fms(%.0fFPS)", deltaTime, 1000.0f / deltaTime);
 
+			ImGui::Separator();
+			ImGui::Text("Loading");
+			ImGui::Text("Time to first frame: %.2fms", time_to_first_frame);
+			if (is_fully_loaded)
+				ImGui::Text("Time to fully loaded: %.2fms", time_to_fully_loaded);
+			else
+			{
+				const bool is_imported = scene_streamer.is_imported.load();
+				ImGui::Text("Streaming meshes: %u/%u", scene_streamer.next_mesh, is_imported ? (uint32_t)scene_streamer.stream_meshes.size() : 0u);
+				ImGui::Text("Streaming textures: %u/%u", scene_streamer.completed_texture_count, is_imported ? (uint32_t)scene_streamer.textures.size() : 0u);
+			}
+
+			ImGui::Separator();
+			ImGui::Text("Scene Graph");
+			ImGui::Text("Nodes: %u (%u updated)", (uint32_t)scene_graph.parents.size(), scene_graph.updated_count);
+			if (ImGui::Button("Benchmark scene graph"))
+			{
+				scene_graph_benchmark = BenchmarkSceneGraph(100000);
+				GFX_PRINTLN("Scene graph update, %u nodes: %.3fms (1%% dirty), %.3fms (100%% dirty)",
+							scene_graph_benchmark.node_count, scene_graph_benchmark.partial_dirty_ms, scene_graph_benchmark.full_dirty_ms);
+			}
+			if (scene_graph_benchmark.node_count > 0)
+				ImGui::Text("%u nodes: %.3fms (1%%) / %.3fms (100%%)", scene_graph_benchmark.node_count,
+							scene_graph_benchmark.partial_dirty_ms, scene_graph_benchmark.full_dirty_ms);
+
 			ImGui::Separator();
 			ImGui::Text("Rendering");
 			if (ImGui::Button("Reload kernels"))
@@ -354,6 +344,16 @@ int main()
 				}
 				ImGui::EndCombo();
 			}
+			if (ImGui::Button("Benchmark HDR decode"))
+			{
+				hdr_benchmark = BenchmarkHDRDecode(env_maps[selected_env_map].string().c_str());
+				GFX_PRINTLN("HDR decode, %.2fMB: stb %.2fms (%.0fMB/s), decoder %.2fms (%.0fMB/s)", hdr_benchmark.file_size_mb,
+							hdr_benchmark.stb_ms, hdr_benchmark.file_size_mb * 1000.0f / hdr_benchmark.stb_ms,
+							hdr_benchmark.decoder_ms, hdr_benchmark.file_size_mb * 1000.0f / hdr_benchmark.decoder_ms);
+			}
+			if (hdr_benchmark.file_size_mb > 0.0f)
+				ImGui::Text("stb: %.0fMB/s, decoder: %.0fMB/s", hdr_benchmark.file_size_mb * 1000.0f / hdr_benchmark.stb_ms,
+							hdr_benchmark.file_size_mb * 1000.0f / hdr_benchmark.decoder_ms);
 
 			ImGui::Separator();
 			ImGui::Text("Debug Views");
@@ -383,17 +383,40 @@ int main()
 			// Sphere Material
 			ImGui::Separator();
 			ImGui::Text("Sphere Material");
-			ImGui::ColorEdit4("Albedo", glm::value_ptr(gpu_meshes[0].material.albedo));
-			ImGui::DragFloat("Metallic", &gpu_meshes[0].material.metallic, 0.05f, 0.0f, 1.0f);
-			ImGui::DragFloat("Roughness", &gpu_meshes[0].material.roughness, 0.05f, 0.0f, 1.0f);
+			if (!gpu_meshes.empty())
+			{
+				ImGui::ColorEdit4("Albedo", glm::value_ptr(gpu_meshes[0].material.albedo));
+				ImGui::DragFloat("Metallic", &gpu_meshes[0].material.metallic, 0.05f, 0.0f, 1.0f);
+				ImGui::DragFloat("Roughness", &gpu_meshes[0].material.roughness, 0.05f, 0.0f, 1.0f);
+			}
 #endif
 			
 			//ImGui::ShowDemoWindow();
 		}
 		ImGui::End();
 
-		if (has_to_change_env_map)
-			load_env_map(env_maps[selected_env_map].string());
+		// The previous environment, or the empty one at startup, stays in use until the new one is decoded
+		if (has_to_change_env_map && !is_loading_env_map)
+		{
+			const std::filesystem::path& env_map_path = env_maps[selected_env_map];
+			if (env_map_path.extension() == ".hdr")
+			{
+				is_loading_env_map = StartHDRTextureLoad(gfx, env_map_path.string().c_str(), env_map_load);
+				GFX_ASSERT(is_loading_env_map);
+			}
+			else
+			{
+				load_env_map(gfxLoadTexture2D(gfx, env_map_path));
+			}
+			has_to_change_env_map = false;
+		}
+		if (is_loading_env_map && IsHDRTextureLoadDone(env_map_load))
+		{
+			GfxTexture environment_map = FinishHDRTextureLoad(gfx, env_map_load);
+			GFX_ASSERT(environment_map);
+			load_env_map(environment_map);
+			is_loading_env_map = false;
+		}
 
 		// Render geometry
 		gfxCommandBeginEvent(gfx, "Geometry Pass");
@@ -416,7 +439,7 @@ int main()
 			gfxProgramSetParameter(gfx, deferredShadingProgram, "metallic_texture", mesh.textured_material.metallic_texture);
 			gfxProgramSetParameter(gfx, deferredShadingProgram, "roughness_texture", mesh.textured_material.roughness_texture);
 			gfxProgramSetParameter(gfx, deferredShadingProgram, "emissive_texture", mesh.textured_material.emissive_texture);
-			gfxProgramSetParameter(gfx, deferredShadingProgram, "model", glm::scale(mesh.transform, glm::vec3(1.5f)));
+			gfxProgramSetParameter(gfx, deferredShadingProgram, "model", scene_graph.world_transforms[mesh.scene_node]);
 			gfxCommandBindVertexBuffer(gfx, mesh.vertex_buffer);
 			gfxCommandBindIndexBuffer(gfx, mesh.index_buffer);
 			gfxCommandDrawIndexed(gfx, mesh.index_count);
@@ -429,14 +452,17 @@ int main()
 
 		// Render sky
 		gfxCommandBeginEvent(gfx, "Sky");
-		gfxProgramSetParameter(gfx, sky_program, "view", camera.view);
-		gfxProgramSetParameter(gfx, sky_program, "proj", camera.proj);
-		gfxProgramSetParameter(gfx, sky_program, "g_EnvironmentCube", environment_cube);
-		gfxProgramSetParameter(gfx, sky_program, "LinearWrap", linear_wrap_sampler);
-		gfxCommandBindKernel(gfx, sky_kernel);
-		gfxCommandBindVertexBuffer(gfx, skybox_mesh.vertex_buffer);
-		gfxCommandBindIndexBuffer(gfx, skybox_mesh.index_buffer);
-		gfxCommandDrawIndexed(gfx, skybox_mesh.index_count);
+		if (skybox_mesh.index_count > 0)
+		{
+			gfxProgramSetParameter(gfx, sky_program, "view", camera.view);
+			gfxProgramSetParameter(gfx, sky_program, "proj", camera.proj);
+			gfxProgramSetParameter(gfx, sky_program, "g_EnvironmentCube", environment_cube);
+			gfxProgramSetParameter(gfx, sky_program, "LinearWrap", linear_wrap_sampler);
+			gfxCommandBindKernel(gfx, sky_kernel);
+			gfxCommandBindVertexBuffer(gfx, skybox_mesh.vertex_buffer);
+			gfxCommandBindIndexBuffer(gfx, skybox_mesh.index_buffer);
+			gfxCommandDrawIndexed(gfx, skybox_mesh.index_count);
+		}
 		gfxCommandEndEvent(gfx);
 
 		// PBR lighting
@@ -490,8 +516,17 @@ int main()
 
 		gfxImGuiRender();
 		gfxFrame(gfx);
+
+		if (frame_index == 0)
+		{
+			time_to_first_frame = startup_timer.ElapsedMilliseconds();
+			GFX_PRINTLN("Time to first frame: %.2fms", time_to_first_frame);
+		}
 	}
 
+	if (is_loading_env_map)
+		gfxDestroyTexture(gfx, FinishHDRTextureLoad(gfx, env_map_load));
+	DestroySceneStreamer(gfx, scene_streamer, empty_texture);
 	gfxImGuiTerminate();
 	gfxDestroyContext(gfx);
 	gfxDestroyWindow(window);
@@ -0,0 +1,230 @@
+#include "scene_graph.h"
+#include "timer.h"
+
+#include <gfx.h>
+
+#include <algorithm>
+#include <cstring>
+#include <emmintrin.h>
+
+// out = a * b, column major like glm
+static inline void MultiplyMatrices(const float* a, const float* b, float* out)
+{
+	const __m128 a0 = _mm_loadu_ps(a + 0);
+	const __m128 a1 = _mm_loadu_ps(a + 4);
+	const __m128 a2 = _mm_loadu_ps(a + 8);
+	const __m128 a3 = _mm_loadu_ps(a + 12);
+	for (uint32_t column = 0; column < 4; ++column)
+	{
+		const float* b_column = b + column * 4;
+		__m128 result = _mm_mul_ps(a0, _mm_set1_ps(b_column[0]));
+		result = _mm_add_ps(result, _mm_mul_ps(a1, _mm_set1_ps(b_column[1])));
+		result = _mm_add_ps(result, _mm_mul_ps(a2, _mm_set1_ps(b_column[2])));
+		result = _mm_add_ps(result, _mm_mul_ps(a3, _mm_set1_ps(b_column[3])));
+		_mm_storeu_ps(out + column * 4, result);
+	}
+}
+
+// Transforms the center and uses the absolute 3x3 to transform the extents (Arvo)
+static inline void TransformBounds(const float* m, const glm::vec3& local_min, const glm::vec3& local_max, glm::vec3& world_min, glm::vec3& world_max)
+{
+	const __m128 half   = _mm_set1_ps(0.5f);
+	const __m128 bmin   = _mm_setr_ps(local_min.x, local_min.y, local_min.z, 0.0f);
+	const __m128 bmax   = _mm_setr_ps(local_max.x, local_max.y, local_max.z, 0.0f);
+	const __m128 center = _mm_mul_ps(_mm_add_ps(bmin, bmax), half);
+	const __m128 extent = _mm_mul_ps(_mm_sub_ps(bmax, bmin), half);
+	const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+
+	const __m128 m0 = _mm_loadu_ps(m + 0);
+	const __m128 m1 = _mm_loadu_ps(m + 4);
+	const __m128 m2 = _mm_loadu_ps(m + 8);
+	const __m128 m3 = _mm_loadu_ps(m + 12);
+
+	__m128 world_center = m3;
+	world_center = _mm_add_ps(world_center, _mm_mul_ps(m0, _mm_shuffle_ps(center, center, _MM_SHUFFLE(0, 0, 0, 0))));
+	world_center = _mm_add_ps(world_center, _mm_mul_ps(m1, _mm_shuffle_ps(center, center, _MM_SHUFFLE(1, 1, 1, 1))));
+	world_center = _mm_add_ps(world_center, _mm_mul_ps(m2, _mm_shuffle_ps(center, center, _MM_SHUFFLE(2, 2, 2, 2))));
+
+	__m128 world_extent = _mm_mul_ps(_mm_and_ps(m0, abs_mask), _mm_shuffle_ps(extent, extent, _MM_SHUFFLE(0, 0, 0, 0)));
+	world_extent = _mm_add_ps(world_extent, _mm_mul_ps(_mm_and_ps(m1, abs_mask), _mm_shuffle_ps(extent, extent, _MM_SHUFFLE(1, 1, 1, 1))));
+	world_extent = _mm_add_ps(world_extent, _mm_mul_ps(_mm_and_ps(m2, abs_mask), _mm_shuffle_ps(extent, extent, _MM_SHUFFLE(2, 2, 2, 2))));
+
+	alignas(16) float result_min[4];
+	alignas(16) float result_max[4];
+	_mm_store_ps(result_min, _mm_sub_ps(world_center, world_extent));
+	_mm_store_ps(result_max, _mm_add_ps(world_center, world_extent));
+	world_min = glm::vec3(result_min[0], result_min[1], result_min[2]);
+	world_max = glm::vec3(result_max[0], result_max[1], result_max[2]);
+}
+
+uint32_t AddSceneNode(SceneGraph& scene_graph, uint32_t parent, const glm::mat4& local_transform,
+					  const glm::vec3& bounds_min, const glm::vec3& bounds_max)
+{
+	const uint32_t node = static_cast<uint32_t>(scene_graph.parents.size());
+	GFX_ASSERT(parent == kInvalidSceneNode || parent < node);
+
+	scene_graph.parents.push_back(parent);
+	scene_graph.dirty.push_back(1);
+	scene_graph.local_transforms.push_back(local_transform);
+	scene_graph.world_transforms.push_back(local_transform);
+	scene_graph.local_bounds_min.push_back(bounds_min);
+	scene_graph.local_bounds_max.push_back(bounds_max);
+	scene_graph.world_bounds_min.push_back(bounds_min);
+	scene_graph.world_bounds_max.push_back(bounds_max);
+
+	return node;
+}
+
+void SetSceneNodeTransform(SceneGraph& scene_graph, uint32_t node, const glm::mat4& local_transform)
+{
+	scene_graph.local_transforms[node] = local_transform;
+	scene_graph.dirty[node] = 1;
+}
+
+template<typename TYPE>
+static void ApplyOrder(std::vector<TYPE>& values, const std::vector<uint32_t>& order)
+{
+	std::vector<TYPE> sorted_values(values.size());
+	for (size_t i = 0; i < order.size(); ++i)
+		sorted_values[i] = values[order[i]];
+	values.swap(sorted_values);
+}
+
+void SortSceneGraph(SceneGraph& scene_graph, std::vector<uint32_t>* remap)
+{
+	const uint32_t node_count = static_cast<uint32_t>(scene_graph.parents.size());
+
+	// Children of each node in insertion order, packed as offsets into a single array
+	std::vector<uint32_t> child_offsets(node_count + 1, 0);
+	for (uint32_t parent : scene_graph.parents)
+		if (parent != kInvalidSceneNode)
+			++child_offsets[parent + 1];
+	for (uint32_t i = 0; i < node_count; ++i)
+		child_offsets[i + 1] += child_offsets[i];
+
+	std::vector<uint32_t> children(child_offsets[node_count]);
+	std::vector<uint32_t> child_counts(node_count, 0);
+	for (uint32_t node = 0; node < node_count; ++node)
+	{
+		const uint32_t parent = scene_graph.parents[node];
+		if (parent != kInvalidSceneNode)
+			children[child_offsets[parent] + child_counts[parent]++] = node;
+	}
+
+	// Breadth-first walk: the roots first, then the children of each visited node in turn,
+	// so the children of a node always end up next to each other
+	std::vector<uint32_t> order;
+	order.reserve(node_count);
+	for (uint32_t node = 0; node < node_count; ++node)
+		if (scene_graph.parents[node] == kInvalidSceneNode)
+			order.push_back(node);
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		const uint32_t node = order[i];
+		order.insert(order.end(), children.begin() + child_offsets[node], children.begin() + child_offsets[node + 1]);
+	}
+	GFX_ASSERT(order.size() == node_count);
+
+	std::vector<uint32_t> new_index(node_count);
+	for (uint32_t i = 0; i < node_count; ++i)
+		new_index[order[i]] = i;
+
+	ApplyOrder(scene_graph.parents, order);
+	for (uint32_t& parent : scene_graph.parents)
+		if (parent != kInvalidSceneNode)
+			parent = new_index[parent];
+	ApplyOrder(scene_graph.dirty, order);
+	ApplyOrder(scene_graph.local_transforms, order);
+	ApplyOrder(scene_graph.world_transforms, order);
+	ApplyOrder(scene_graph.local_bounds_min, order);
+	ApplyOrder(scene_graph.local_bounds_max, order);
+	ApplyOrder(scene_graph.world_bounds_min, order);
+	ApplyOrder(scene_graph.world_bounds_max, order);
+
+	if (remap)
+		remap->swap(new_index);
+}
+
+void UpdateSceneGraph(SceneGraph& scene_graph)
+{
+	const uint32_t node_count = static_cast<uint32_t>(scene_graph.parents.size());
+	const uint32_t* parents = scene_graph.parents.data();
+	uint8_t* dirty = scene_graph.dirty.data();
+	const glm::mat4* local_transforms = scene_graph.local_transforms.data();
+	glm::mat4* world_transforms = scene_graph.world_transforms.data();
+
+	uint32_t updated_count = 0;
+	for (uint32_t node = 0; node < node_count; ++node)
+	{
+		const uint32_t parent = parents[node];
+		if (parent != kInvalidSceneNode)
+			dirty[node] |= dirty[parent]; // parent was already visited, so this pulls dirtiness down the subtree
+		if (!dirty[node])
+			continue;
+
+		if (parent == kInvalidSceneNode)
+			world_transforms[node] = local_transforms[node];
+		else
+			MultiplyMatrices(&world_transforms[parent][0][0], &local_transforms[node][0][0], &world_transforms[node][0][0]);
+
+		TransformBounds(&world_transforms[node][0][0], scene_graph.local_bounds_min[node], scene_graph.local_bounds_max[node],
+						scene_graph.world_bounds_min[node], scene_graph.world_bounds_max[node]);
+		++updated_count;
+	}
+
+	if (updated_count > 0)
+		memset(dirty, 0, node_count);
+	scene_graph.updated_count = updated_count;
+}
+
+SceneGraphBenchmark BenchmarkSceneGraph(uint32_t node_count)
+{
+	GFX_ASSERT(node_count >= 100);
+
+	// 4-ary tree, built breadth-first, each node offset and slightly rotated from its parent
+	SceneGraph scene_graph;
+	for (uint32_t i = 0; i < node_count; ++i)
+	{
+		const uint32_t parent = i == 0 ? kInvalidSceneNode : (i - 1) / 4;
+		glm::mat4 local_transform(1.0f);
+		local_transform[0][0] = local_transform[2][2] = glm::cos(0.01f * i);
+		local_transform[0][2] = glm::sin(0.01f * i);
+		local_transform[2][0] = -local_transform[0][2];
+		local_transform[3] = glm::vec4(1.0f, 0.5f * (i % 4), 0.0f, 1.0f);
+		AddSceneNode(scene_graph, parent, local_transform, glm::vec3(-1.0f), glm::vec3(1.0f));
+	}
+	UpdateSceneGraph(scene_graph);
+
+	const uint32_t iteration_count = 16;
+
+	SceneGraphBenchmark benchmark = {};
+	benchmark.node_count = node_count;
+
+	// Dirty 1% of the nodes, picked among the leaves which are the last 3/4 of a 4-ary tree
+	Timer timer;
+	float elapsed_ms = 0.0f;
+	for (uint32_t iteration = 0; iteration < iteration_count; ++iteration)
+	{
+		for (uint32_t i = 0; i < node_count / 100; ++i)
+		{
+			const uint32_t node = node_count - 1 - (i * 50 + iteration) % (node_count / 2);
+			SetSceneNodeTransform(scene_graph, node, scene_graph.local_transforms[node]);
+		}
+		timer.Record();
+		UpdateSceneGraph(scene_graph);
+		elapsed_ms += timer.ElapsedMilliseconds();
+	}
+	benchmark.partial_dirty_ms = elapsed_ms / iteration_count;
+
+	elapsed_ms = 0.0f;
+	for (uint32_t iteration = 0; iteration < iteration_count; ++iteration)
+	{
+		SetSceneNodeTransform(scene_graph, 0, scene_graph.local_transforms[0]);
+		timer.Record();
+		UpdateSceneGraph(scene_graph);
+		elapsed_ms += timer.ElapsedMilliseconds();
+	}
+	benchmark.full_dirty_ms = elapsed_ms / iteration_count;
+
+	return benchmark;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+static const uint32_t kInvalidSceneNode = 0xFFFFFFFFu;
+
+// Transform hierarchy stored as structure of arrays. A parent always comes before its
+// children, so a single linear pass over the arrays is enough to propagate transforms
+// down the hierarchy. SortSceneGraph reorders the nodes breadth-first.
+struct SceneGraph
+{
+	std::vector<uint32_t> parents;
+	std::vector<uint8_t>  dirty;
+
+	std::vector<glm::mat4> local_transforms;
+	std::vector<glm::mat4> world_transforms;
+
+	// Bounds in node space, and the refitted world space AABB
+	std::vector<glm::vec3> local_bounds_min;
+	std::vector<glm::vec3> local_bounds_max;
+	std::vector<glm::vec3> world_bounds_min;
+	std::vector<glm::vec3> world_bounds_max;
+
+	// Nodes updated by the last UpdateSceneGraph call
+	uint32_t updated_count = 0;
+};
+
+struct SceneGraphBenchmark
+{
+	uint32_t node_count;
+	float partial_dirty_ms; // 1% of the nodes dirty
+	float full_dirty_ms;    // every node dirty
+};
+
+uint32_t AddSceneNode(SceneGraph& scene_graph, uint32_t parent, const glm::mat4& local_transform,
+					  const glm::vec3& bounds_min = glm::vec3(0.0f), const glm::vec3& bounds_max = glm::vec3(0.0f));
+void SetSceneNodeTransform(SceneGraph& scene_graph, uint32_t node, const glm::mat4& local_transform);
+
+// Reorders the nodes breadth-first with the children of a node stored contiguously,
+// remap[old_index] receives the new index of each node and must be applied to any held node index
+void SortSceneGraph(SceneGraph& scene_graph, std::vector<uint32_t>* remap = nullptr);
+
+// Recomputes world transforms and bounds of the dirty nodes and their subtrees
+void UpdateSceneGraph(SceneGraph& scene_graph);
+
+SceneGraphBenchmark BenchmarkSceneGraph(uint32_t node_count);
@@ -0,0 +1,586 @@
+#include "scene_streamer.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <filesystem>
+
+#include <tiny_gltf.h>
+#include "stb_image.h"
+
+static GfxTexture& GetSlotTexture(GPUMesh& gpu_mesh, uint32_t slot)
+{
+	switch (slot)
+	{
+	case kStreamTextureSlot_Metallic:  return gpu_mesh.textured_material.metallic_texture;
+	case kStreamTextureSlot_Roughness: return gpu_mesh.textured_material.roughness_texture;
+	case kStreamTextureSlot_Emissive:  return gpu_mesh.textured_material.emissive_texture;
+	default:                           return gpu_mesh.textured_material.albedo_texture;
+	}
+}
+
+// External image files are read by the decode workers, tinygltf only gets to read the json and the buffers.
+// It keeps the uri of the images it fails to read.
+static bool ReadNonImageFile(std::vector<unsigned char>* bytes, std::string* error, const std::string& path, void* user_data)
+{
+	static const char* kImageExtensions[] = { ".png", ".jpg", ".jpeg", ".bmp", ".tga", ".gif", ".psd", ".hdr", ".pic", ".pnm" };
+
+	std::string extension = std::filesystem::path(path).extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return static_cast<char>(tolower(c)); });
+	for (const char* image_extension : kImageExtensions)
+	{
+		if (extension == image_extension)
+		{
+			if (error)
+				*error += "Image file reads are deferred to the decode workers";
+			return false;
+		}
+	}
+	return tinygltf::ReadWholeFile(bytes, error, path, user_data);
+}
+
+// Image decoding is left to the streaming workers, only keep the bytes of the embedded images around
+static bool KeepEncodedImage(tinygltf::Image* image, const int image_index, std::string* error, std::string* warning,
+							 int requested_width, int requested_height, const unsigned char* bytes, int size, void* user_data)
+{
+	image->image.assign(bytes, bytes + size);
+	image->width = image->height = image->component = -1;
+	return true;
+}
+
+static glm::mat4 GetNodeTransform(const tinygltf::Node& node)
+{
+	glm::mat4 transform(1.0f);
+	if (node.matrix.size() == 16)
+	{
+		for (uint32_t i = 0; i < 16; ++i)
+			transform[i / 4][i % 4] = static_cast<float>(node.matrix[i]);
+		return transform;
+	}
+
+	if (node.translation.size() == 3)
+		transform = glm::translate(transform, glm::vec3(glm::make_vec3(node.translation.data())));
+	if (node.rotation.size() == 4)
+		transform *= glm::mat4_cast(glm::quat(static_cast<float>(node.rotation[3]), static_cast<float>(node.rotation[0]),
+											  static_cast<float>(node.rotation[1]), static_cast<float>(node.rotation[2])));
+	if (node.scale.size() == 3)
+		transform = glm::scale(transform, glm::vec3(glm::make_vec3(node.scale.data())));
+	return transform;
+}
+
+template<typename TYPE>
+static bool IsValidIndex(const std::vector<TYPE>& elements, int index)
+{
+	return index >= 0 && index < static_cast<int>(elements.size());
+}
+
+// Returns null if the accessor, its buffer view or its buffer is out of bounds, or if the
+// elements of size element_size don't fit in the buffer view
+static const uint8_t* GetAccessorData(const tinygltf::Model& model, int accessor_index, size_t element_size, size_t& count, size_t& stride)
+{
+	if (!IsValidIndex(model.accessors, accessor_index))
+		return nullptr;
+
+	const tinygltf::Accessor& accessor = model.accessors[accessor_index];
+	if (!IsValidIndex(model.bufferViews, accessor.bufferView))
+		return nullptr;
+
+	const tinygltf::BufferView& buffer_view = model.bufferViews[accessor.bufferView];
+	if (!IsValidIndex(model.buffers, buffer_view.buffer))
+		return nullptr;
+
+	const tinygltf::Buffer& buffer = model.buffers[buffer_view.buffer];
+	if (buffer_view.byteOffset > buffer.data.size() || buffer_view.byteLength > buffer.data.size() - buffer_view.byteOffset)
+		return nullptr;
+
+	const int byte_stride = accessor.ByteStride(buffer_view);
+	if (byte_stride <= 0 || static_cast<size_t>(byte_stride) < element_size)
+		return nullptr;
+
+	count  = accessor.count;
+	stride = static_cast<size_t>(byte_stride);
+	if (count > 0)
+	{
+		// byteOffset + (count - 1) * stride + element_size must fit in the buffer view
+		if (accessor.byteOffset > buffer_view.byteLength || buffer_view.byteLength - accessor.byteOffset < element_size)
+			return nullptr;
+		if (count - 1 > (buffer_view.byteLength - accessor.byteOffset - element_size) / stride)
+			return nullptr;
+	}
+	return buffer.data.data() + buffer_view.byteOffset + accessor.byteOffset;
+}
+
+// Copies a float vertex attribute, false if the accessor is out of bounds. The positions
+// are read first and set the vertex count, the other attributes have to match it.
+template<typename TYPE>
+static bool ReadVertexAttribute(const tinygltf::Model& model, int accessor_index, std::vector<GfxVertex>& vertices, TYPE GfxVertex::* attribute, size_t element_size)
+{
+	size_t count, stride;
+	const uint8_t* data = GetAccessorData(model, accessor_index, element_size, count, stride);
+	if (!data || model.accessors[accessor_index].componentType != TINYGLTF_COMPONENT_TYPE_FLOAT)
+		return false;
+
+	if (vertices.empty())
+		vertices.resize(count);
+	else if (count != vertices.size())
+		return false;
+
+	for (size_t i = 0; i < count; ++i)
+		memcpy(&(vertices[i].*attribute), data + i * stride, element_size);
+	return true;
+}
+
+static bool ReadPrimitive(const tinygltf::Model& model, const tinygltf::Primitive& primitive, StreamMesh& stream_mesh)
+{
+	if (primitive.mode != -1 && primitive.mode != TINYGLTF_MODE_TRIANGLES)
+		return false;
+
+	auto position_attribute = primitive.attributes.find("POSITION");
+	if (position_attribute == primitive.attributes.end())
+		return false;
+
+	if (!ReadVertexAttribute(model, position_attribute->second, stream_mesh.vertices, &GfxVertex::position, sizeof(glm::vec3)))
+		return false;
+	const size_t vertex_count = stream_mesh.vertices.size();
+
+	// Optional attributes are skipped when their format doesn't match, but reject the primitive when out of bounds
+	auto normal_attribute = primitive.attributes.find("NORMAL");
+	if (normal_attribute != primitive.attributes.end())
+	{
+		if (!IsValidIndex(model.accessors, normal_attribute->second))
+			return false;
+
+		const tinygltf::Accessor& normals = model.accessors[normal_attribute->second];
+		if (normals.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT && normals.count == vertex_count &&
+			!ReadVertexAttribute(model, normal_attribute->second, stream_mesh.vertices, &GfxVertex::normal, sizeof(glm::vec3)))
+			return false;
+	}
+
+	auto uv_attribute = primitive.attributes.find("TEXCOORD_0");
+	if (uv_attribute != primitive.attributes.end())
+	{
+		if (!IsValidIndex(model.accessors, uv_attribute->second))
+			return false;
+
+		const tinygltf::Accessor& uvs = model.accessors[uv_attribute->second];
+		if (uvs.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT && uvs.count == vertex_count &&
+			!ReadVertexAttribute(model, uv_attribute->second, stream_mesh.vertices, &GfxVertex::uv, sizeof(glm::vec2)))
+			return false;
+	}
+
+	if (primitive.indices < 0)
+	{
+		stream_mesh.indices.resize(vertex_count);
+		for (size_t i = 0; i < vertex_count; ++i)
+			stream_mesh.indices[i] = static_cast<uint32_t>(i);
+		return true;
+	}
+
+	if (!IsValidIndex(model.accessors, primitive.indices))
+		return false;
+
+	size_t index_size;
+	switch (model.accessors[primitive.indices].componentType)
+	{
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:  index_size = sizeof(uint8_t);  break;
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: index_size = sizeof(uint16_t); break;
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:   index_size = sizeof(uint32_t); break;
+	default: return false;
+	}
+
+	size_t index_count, stride;
+	const uint8_t* data = GetAccessorData(model, primitive.indices, index_size, index_count, stride);
+	if (!data)
+		return false;
+
+	stream_mesh.indices.resize(index_count);
+	for (size_t i = 0; i < index_count; ++i)
+	{
+		uint32_t index;
+		switch (index_size)
+		{
+		case sizeof(uint8_t):  index = data[i * stride]; break;
+		case sizeof(uint16_t): index = *reinterpret_cast<const uint16_t*>(data + i * stride); break;
+		default:               index = *reinterpret_cast<const uint32_t*>(data + i * stride); break;
+		}
+
+		// The gpu would read past the vertex buffer
+		if (index >= vertex_count)
+			return false;
+		stream_mesh.indices[i] = index;
+	}
+	return true;
+}
+
+static uint32_t GetStreamTexture(SceneStreamer* streamer, const tinygltf::Model& model, int texture_index, StreamTextureLayout layout)
+{
+	if (!IsValidIndex(model.textures, texture_index) || !IsValidIndex(model.images, model.textures[texture_index].source))
+		return kInvalidStreamTexture;
+
+	const uint32_t image_index = static_cast<uint32_t>(model.textures[texture_index].source);
+	StreamImage& image = streamer->images[image_index];
+	if (image.textures[layout] == kInvalidStreamTexture)
+	{
+		image.textures[layout] = static_cast<uint32_t>(streamer->textures.size());
+
+		StreamTexture& texture = streamer->textures.emplace_back();
+		texture.image  = image_index;
+		texture.layout = layout;
+	}
+	return image.textures[layout];
+}
+
+static void DecodeImages(SceneStreamer* streamer)
+{
+	for (;;)
+	{
+		const uint32_t order_index = streamer->next_image.fetch_add(1);
+		if (order_index >= streamer->image_order.size() || streamer->is_cancelled.load())
+			break;
+
+		StreamImage& image = streamer->images[streamer->image_order[order_index]];
+
+		int width = 0, height = 0, num_channels;
+		stbi_uc* pixels = nullptr;
+		if (!image.encoded.empty())
+			pixels = stbi_load_from_memory(image.encoded.data(), static_cast<int>(image.encoded.size()), &width, &height, &num_channels, 4);
+		else if (!image.path.empty())
+			pixels = stbi_load(image.path.c_str(), &width, &height, &num_channels, 4);
+		std::vector<uint8_t>().swap(image.encoded);
+
+		std::vector<DecodedTexture> decoded_textures;
+		for (uint32_t layout = 0; layout < kStreamTextureLayout_Count; ++layout)
+		{
+			if (image.textures[layout] == kInvalidStreamTexture)
+				continue;
+
+			DecodedTexture& decoded_texture = decoded_textures.emplace_back();
+			decoded_texture.texture = image.textures[layout];
+			decoded_texture.width   = static_cast<uint32_t>(width);
+			decoded_texture.height  = static_cast<uint32_t>(height);
+			if (!pixels)
+				continue;
+
+			const size_t texel_count = static_cast<size_t>(width) * height;
+			if (layout == kStreamTextureLayout_RGBA)
+			{
+				decoded_texture.pixels.assign(pixels, pixels + texel_count * 4);
+				continue;
+			}
+
+			// glTF stores metallic in blue and roughness in green, the shaders read them from red
+			const uint32_t channel = layout == kStreamTextureLayout_Metallic ? 2 : 1;
+			decoded_texture.pixels.resize(texel_count * 4);
+			for (size_t i = 0; i < texel_count; ++i)
+			{
+				const uint8_t value = pixels[i * 4 + channel];
+				decoded_texture.pixels[i * 4 + 0] = value;
+				decoded_texture.pixels[i * 4 + 1] = value;
+				decoded_texture.pixels[i * 4 + 2] = value;
+				decoded_texture.pixels[i * 4 + 3] = 255;
+			}
+		}
+		if (pixels)
+			stbi_image_free(pixels);
+
+		std::lock_guard<std::mutex> lock(streamer->decoded_mutex);
+		for (DecodedTexture& decoded_texture : decoded_textures)
+			streamer->decoded_textures.push_back(std::move(decoded_texture));
+	}
+}
+
+static void ImportScene(SceneStreamer* streamer)
+{
+	// Only the json and the buffers get read here, images are left to the decode workers
+	tinygltf::FsCallbacks fs = {};
+	fs.FileExists     = &tinygltf::FileExists;
+	fs.ExpandFilePath = &tinygltf::ExpandFilePath;
+	fs.ReadWholeFile  = &ReadNonImageFile;
+	fs.WriteWholeFile = &tinygltf::WriteWholeFile;
+
+	tinygltf::TinyGLTF loader;
+	loader.SetFsCallbacks(fs);
+	loader.SetImageLoader(KeepEncodedImage, nullptr);
+
+	tinygltf::Model model;
+	std::string error, warning;
+	const bool is_binary = std::filesystem::path(streamer->asset_path).extension() == ".glb";
+	const bool result = is_binary ? loader.LoadBinaryFromFile(&model, &error, &warning, streamer->asset_path)
+								  : loader.LoadASCIIFromFile(&model, &error, &warning, streamer->asset_path);
+	if (!result)
+	{
+		GFX_PRINTLN("Unable to load '%s': %s", streamer->asset_path.c_str(), error.c_str());
+		streamer->is_imported.store(true, std::memory_order_release);
+		return;
+	}
+
+	const std::filesystem::path base_directory = std::filesystem::path(streamer->asset_path).parent_path();
+	streamer->images.resize(model.images.size());
+	for (size_t i = 0; i < model.images.size(); ++i)
+	{
+		StreamImage& image = streamer->images[i];
+		image.encoded.swap(model.images[i].image);
+		if (image.encoded.empty() && !model.images[i].uri.empty())
+			image.path = (base_directory / model.images[i].uri).string();
+		std::fill_n(image.textures, kStreamTextureLayout_Count, kInvalidStreamTexture);
+		image.distance = FLT_MAX;
+	}
+
+	// Flatten the node hierarchy, one mesh per primitive like gfxSceneImport does
+	struct NodeEntry
+	{
+		int node;
+		glm::mat4 transform;
+	};
+	std::vector<NodeEntry> node_stack;
+	const int scene_index = model.defaultScene >= 0 ? model.defaultScene : 0;
+	if (IsValidIndex(model.scenes, scene_index))
+		for (int node : model.scenes[scene_index].nodes)
+			node_stack.push_back({ node, glm::mat4(1.0f) });
+
+	// A node can only have one parent, visiting a node twice means the file has a cycle
+	std::vector<uint8_t> visited_nodes(model.nodes.size(), 0);
+
+	std::vector<StreamMesh> stream_meshes;
+	std::vector<float> distances;
+	while (!node_stack.empty())
+	{
+		const NodeEntry entry = node_stack.back();
+		node_stack.pop_back();
+
+		if (!IsValidIndex(model.nodes, entry.node) || visited_nodes[entry.node])
+			continue;
+		visited_nodes[entry.node] = 1;
+
+		const tinygltf::Node& node = model.nodes[entry.node];
+		const glm::mat4 transform = entry.transform * GetNodeTransform(node);
+		for (int child : node.children)
+			node_stack.push_back({ child, transform });
+
+		if (!IsValidIndex(model.meshes, node.mesh))
+			continue;
+
+		for (const tinygltf::Primitive& primitive : model.meshes[node.mesh].primitives)
+		{
+			StreamMesh stream_mesh;
+			if (primitive.material >= static_cast<int>(model.materials.size()) || !ReadPrimitive(model, primitive, stream_mesh))
+				continue;
+
+			stream_mesh.transform = transform;
+
+			stream_mesh.bounds_min = glm::vec3(FLT_MAX);
+			stream_mesh.bounds_max = glm::vec3(-FLT_MAX);
+			for (const GfxVertex& vertex : stream_mesh.vertices)
+			{
+				stream_mesh.bounds_min = glm::min(stream_mesh.bounds_min, vertex.position);
+				stream_mesh.bounds_max = glm::max(stream_mesh.bounds_max, vertex.position);
+			}
+			if (stream_mesh.vertices.empty())
+				stream_mesh.bounds_min = stream_mesh.bounds_max = glm::vec3(0.0f);
+
+			std::fill_n(stream_mesh.textures, kStreamTextureSlot_Count, kInvalidStreamTexture);
+			if (primitive.material >= 0)
+			{
+				const tinygltf::Material& material = model.materials[primitive.material];
+				const tinygltf::PbrMetallicRoughness& pbr = material.pbrMetallicRoughness;
+
+				stream_mesh.material.albedo    = pbr.baseColorFactor.size() == 4 ? float4(glm::make_vec4(pbr.baseColorFactor.data())) : float4(1.0f);
+				stream_mesh.material.roughness = static_cast<float>(pbr.roughnessFactor);
+				stream_mesh.material.metallic  = static_cast<float>(pbr.metallicFactor);
+
+				stream_mesh.textures[kStreamTextureSlot_Albedo]    = GetStreamTexture(streamer, model, pbr.baseColorTexture.index, kStreamTextureLayout_RGBA);
+				stream_mesh.textures[kStreamTextureSlot_Metallic]  = GetStreamTexture(streamer, model, pbr.metallicRoughnessTexture.index, kStreamTextureLayout_Metallic);
+				stream_mesh.textures[kStreamTextureSlot_Roughness] = GetStreamTexture(streamer, model, pbr.metallicRoughnessTexture.index, kStreamTextureLayout_Roughness);
+				stream_mesh.textures[kStreamTextureSlot_Emissive]  = GetStreamTexture(streamer, model, material.emissiveTexture.index, kStreamTextureLayout_RGBA);
+			}
+			else
+			{
+				stream_mesh.material.albedo    = float4(1.0f);
+				stream_mesh.material.roughness = 1.0f;
+				stream_mesh.material.metallic  = 1.0f;
+			}
+
+			// Same transform as the one used for drawing, parent included
+			const glm::vec3 center = (stream_mesh.bounds_min + stream_mesh.bounds_max) * 0.5f;
+			const glm::vec3 world_center = glm::vec3(streamer->parent_transform * transform * glm::vec4(center, 1.0f));
+			distances.push_back(glm::distance(world_center, streamer->initial_eye));
+			stream_meshes.push_back(std::move(stream_mesh));
+		}
+	}
+
+	// Closest meshes first, images follow the distance of the closest mesh using them
+	std::vector<uint32_t> mesh_order(stream_meshes.size());
+	for (uint32_t i = 0; i < mesh_order.size(); ++i)
+		mesh_order[i] = i;
+	std::stable_sort(mesh_order.begin(), mesh_order.end(), [&distances](uint32_t a, uint32_t b)
+	{
+		return distances[a] < distances[b];
+	});
+
+	streamer->stream_meshes.reserve(stream_meshes.size());
+	for (uint32_t mesh_order_index : mesh_order)
+	{
+		const uint32_t mesh_index = static_cast<uint32_t>(streamer->stream_meshes.size());
+		StreamMesh& stream_mesh = streamer->stream_meshes.emplace_back(std::move(stream_meshes[mesh_order_index]));
+		for (uint32_t slot = 0; slot < kStreamTextureSlot_Count; ++slot)
+		{
+			if (stream_mesh.textures[slot] == kInvalidStreamTexture)
+				continue;
+
+			StreamTexture& texture = streamer->textures[stream_mesh.textures[slot]];
+			texture.users.push_back(mesh_index * kStreamTextureSlot_Count + slot);
+
+			StreamImage& image = streamer->images[texture.image];
+			image.distance = std::min(image.distance, distances[mesh_order_index]);
+		}
+	}
+
+	for (uint32_t i = 0; i < streamer->images.size(); ++i)
+	{
+		if (streamer->images[i].distance < FLT_MAX) // skip the images no mesh uses
+			streamer->image_order.push_back(i);
+	}
+	std::stable_sort(streamer->image_order.begin(), streamer->image_order.end(), [streamer](uint32_t a, uint32_t b)
+	{
+		return streamer->images[a].distance < streamer->images[b].distance;
+	});
+
+	streamer->is_imported.store(true, std::memory_order_release);
+
+	// hardware_concurrency() may return 0, keep a core for the main thread when there is more than one
+	const uint32_t hardware_thread_count = std::thread::hardware_concurrency();
+	const uint32_t worker_count = hardware_thread_count > 1 ? hardware_thread_count - 1 : 1u;
+	const uint32_t thread_count = std::max(1u, std::min(worker_count, static_cast<uint32_t>(streamer->image_order.size())));
+	for (uint32_t i = 0; i < thread_count; ++i)
+		streamer->decode_threads.emplace_back(DecodeImages, streamer);
+}
+
+void StartSceneStreaming(SceneStreamer& streamer, const char* asset_path, const glm::vec3& eye, const SceneGraph& scene_graph, uint32_t parent_node)
+{
+	streamer.asset_path       = asset_path;
+	streamer.initial_eye      = eye;
+	streamer.parent_node      = parent_node;
+	streamer.parent_transform = scene_graph.world_transforms[parent_node];
+	streamer.import_thread    = std::thread(ImportScene, &streamer);
+}
+
+void UpdateSceneStreaming(GfxContext gfx, SceneStreamer& streamer, SceneGraph& scene_graph, GfxTexture empty_texture)
+{
+	if (!streamer.is_imported.load(std::memory_order_acquire))
+		return;
+
+	uint64_t uploaded_size = 0;
+	auto has_budget = [&streamer, &uploaded_size](uint64_t upload_size)
+	{
+		return uploaded_size == 0 || uploaded_size + upload_size <= streamer.upload_budget;
+	};
+
+	// Geometry first, closest meshes first
+	while (streamer.next_mesh < streamer.stream_meshes.size())
+	{
+		StreamMesh& stream_mesh = streamer.stream_meshes[streamer.next_mesh];
+		const uint64_t upload_size = sizeof(GfxVertex) * stream_mesh.vertices.size() + sizeof(uint32_t) * stream_mesh.indices.size();
+		if (!has_budget(upload_size))
+			return;
+		uploaded_size += upload_size;
+		++streamer.next_mesh;
+
+		GPUMesh& gpu_mesh = streamer.meshes.emplace_back();
+		gpu_mesh.material = stream_mesh.material;
+
+		// Textures decoded before the geometry made it in are used right away, the rest stay on the placeholder
+		for (uint32_t slot = 0; slot < kStreamTextureSlot_Count; ++slot)
+		{
+			const uint32_t texture = stream_mesh.textures[slot];
+			const bool is_uploaded = texture != kInvalidStreamTexture && streamer.textures[texture].texture;
+			GetSlotTexture(gpu_mesh, slot) = is_uploaded ? streamer.textures[texture].texture : empty_texture;
+		}
+
+		gpu_mesh.scene_node    = AddSceneNode(scene_graph, streamer.parent_node, stream_mesh.transform, stream_mesh.bounds_min, stream_mesh.bounds_max);
+		gpu_mesh.index_count   = static_cast<uint32_t>(stream_mesh.indices.size());
+		gpu_mesh.vertex_buffer = gfxCreateBuffer(gfx, sizeof(GfxVertex) * stream_mesh.vertices.size(), stream_mesh.vertices.data());
+		gpu_mesh.index_buffer  = gfxCreateBuffer(gfx, sizeof(uint32_t) * stream_mesh.indices.size(), stream_mesh.indices.data());
+
+		std::vector<GfxVertex>().swap(stream_mesh.vertices);
+		std::vector<uint32_t>().swap(stream_mesh.indices);
+	}
+
+	// Then the textures, in the order the workers finished them
+	{
+		std::lock_guard<std::mutex> lock(streamer.decoded_mutex);
+		for (DecodedTexture& decoded_texture : streamer.decoded_textures)
+			streamer.pending_textures.push_back(std::move(decoded_texture));
+		streamer.decoded_textures.clear();
+	}
+
+	uint32_t processed_count = 0;
+	for (; processed_count < streamer.pending_textures.size(); ++processed_count)
+	{
+		DecodedTexture& decoded_texture = streamer.pending_textures[processed_count];
+		if (!has_budget(decoded_texture.pixels.size()))
+			break;
+		uploaded_size += decoded_texture.pixels.size();
+		++streamer.completed_texture_count;
+
+		if (decoded_texture.pixels.empty())
+			continue; // failed to decode, keep the placeholder
+
+		GfxTexture texture = gfxCreateTexture2D(gfx, decoded_texture.width, decoded_texture.height, DXGI_FORMAT_R8G8B8A8_UNORM,
+												gfxCalculateMipCount(decoded_texture.width, decoded_texture.height));
+
+		GfxBuffer upload_texture_buffer = gfxCreateBuffer(gfx, decoded_texture.pixels.size(), decoded_texture.pixels.data(), kGfxCpuAccess_Write);
+
+		gfxCommandCopyBufferToTexture(gfx, texture, upload_texture_buffer);
+		gfxDestroyBuffer(gfx, upload_texture_buffer);
+		gfxCommandGenerateMips(gfx, texture);
+
+		StreamTexture& stream_texture = streamer.textures[decoded_texture.texture];
+		stream_texture.texture = texture;
+		for (uint32_t user : stream_texture.users)
+		{
+			const uint32_t mesh_index = user / kStreamTextureSlot_Count;
+			if (mesh_index < streamer.meshes.size())
+				GetSlotTexture(streamer.meshes[mesh_index], user % kStreamTextureSlot_Count) = texture;
+		}
+	}
+	streamer.pending_textures.erase(streamer.pending_textures.begin(), streamer.pending_textures.begin() + processed_count);
+}
+
+bool IsSceneStreamingComplete(const SceneStreamer& streamer)
+{
+	return streamer.is_imported.load(std::memory_order_acquire) &&
+		   streamer.next_mesh == streamer.stream_meshes.size() &&
+		   streamer.completed_texture_count == streamer.textures.size();
+}
+
+void DestroySceneStreamer(GfxContext gfx, SceneStreamer& streamer, GfxTexture empty_texture)
+{
+	streamer.is_cancelled.store(true);
+	if (streamer.import_thread.joinable())
+		streamer.import_thread.join();
+	for (std::thread& decode_thread : streamer.decode_threads)
+		decode_thread.join();
+	streamer.decode_threads.clear();
+
+	for (GPUMesh& gpu_mesh : streamer.meshes)
+	{
+		gfxDestroyBuffer(gfx, gpu_mesh.vertex_buffer);
+		gfxDestroyBuffer(gfx, gpu_mesh.index_buffer);
+	}
+	for (StreamTexture& stream_texture : streamer.textures)
+		if (stream_texture.texture && stream_texture.texture.handle != empty_texture.handle)
+			gfxDestroyTexture(gfx, stream_texture.texture);
+
+	streamer.meshes.clear();
+	streamer.stream_meshes.clear();
+	streamer.images.clear();
+	streamer.textures.clear();
+	streamer.image_order.clear();
+	streamer.pending_textures.clear();
+	streamer.decoded_textures.clear();
+	streamer.next_mesh = 0;
+	streamer.completed_texture_count = 0;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <gfx_scene.h>
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gpu_shared.h"
+#include "scene_graph.h"
+
+enum StreamTextureSlot
+{
+	kStreamTextureSlot_Albedo,
+	kStreamTextureSlot_Metallic,
+	kStreamTextureSlot_Roughness,
+	kStreamTextureSlot_Emissive,
+
+	kStreamTextureSlot_Count
+};
+
+// Which channels of the source image end up in the texture, metallic and roughness
+// are split out of the glTF metallic-roughness image into the red channel
+enum StreamTextureLayout
+{
+	kStreamTextureLayout_RGBA,
+	kStreamTextureLayout_Metallic,
+	kStreamTextureLayout_Roughness,
+
+	kStreamTextureLayout_Count
+};
+
+static const uint32_t kInvalidStreamTexture = 0xFFFFFFFFu;
+
+// Geometry extracted by the import thread, released once uploaded
+struct StreamMesh
+{
+	std::vector<GfxVertex> vertices;
+	std::vector<uint32_t> indices;
+	glm::mat4 transform; // relative to the parent node
+	glm::vec3 bounds_min;
+	glm::vec3 bounds_max;
+	GPUMaterial material;
+	uint32_t textures[kStreamTextureSlot_Count]; // index into SceneStreamer::textures
+};
+
+struct StreamImage
+{
+	std::vector<uint8_t> encoded; // embedded images, decoded by the workers
+	std::string path;             // external images, read and decoded by the workers
+	uint32_t textures[kStreamTextureLayout_Count];
+	float distance;               // of the closest mesh using it
+};
+
+struct StreamTexture
+{
+	uint32_t image;
+	StreamTextureLayout layout;
+	GfxTexture texture;
+	std::vector<uint32_t> users; // mesh_index * kStreamTextureSlot_Count + slot
+};
+
+struct DecodedTexture
+{
+	uint32_t texture;
+	uint32_t width;
+	uint32_t height;
+	std::vector<uint8_t> pixels; // RGBA8, empty if decoding failed
+};
+
+struct SceneStreamer
+{
+	std::string asset_path;
+	glm::vec3 initial_eye;
+	glm::mat4 parent_transform; // world transform of parent_node, used for the priorities
+	uint32_t parent_node;
+
+	// Upload budget in bytes per frame, at least one upload is always processed per frame
+	uint64_t upload_budget = 16ull << 20;
+
+	// Meshes that finished uploading their geometry, textures stay on the placeholder until streamed in
+	std::vector<GPUMesh> meshes;
+
+	// Filled by the import thread, meshes are sorted by distance to the initial camera and
+	// image_order lists the images by the distance of their closest mesh
+	std::vector<StreamMesh> stream_meshes;
+	std::vector<StreamImage> images;
+	std::vector<StreamTexture> textures;
+	std::vector<uint32_t> image_order;
+	uint32_t next_mesh = 0;
+	uint32_t completed_texture_count = 0;
+	std::vector<DecodedTexture> pending_textures; // decoded but waiting for upload budget
+
+	// Decoding workers pick images in priority order and hand the results over through the queue
+	std::atomic<uint32_t> next_image = 0;
+	std::mutex decoded_mutex;
+	std::vector<DecodedTexture> decoded_textures;
+
+	std::thread import_thread;
+	std::vector<std::thread> decode_threads;
+	std::atomic<bool> is_imported = false;
+	std::atomic<bool> is_cancelled = false;
+};
+
+void StartSceneStreaming(SceneStreamer& streamer, const char* asset_path, const glm::vec3& eye, const SceneGraph& scene_graph, uint32_t parent_node);
+void UpdateSceneStreaming(GfxContext gfx, SceneStreamer& streamer, SceneGraph& scene_graph, GfxTexture empty_texture);
+bool IsSceneStreamingComplete(const SceneStreamer& streamer);
+void DestroySceneStreamer(GfxContext gfx, SceneStreamer& streamer, GfxTexture empty_texture);